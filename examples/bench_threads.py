@@ -0,0 +1,66 @@
+"""Find the thread_budget crossover on this machine.
+
+For each block shape M x n, time updating a batch of irf_exp_model blocks
+(n - 1 rates plus the intercept) with every split of the core budget between
+concurrent blocks and BLAS threads, and report the fastest split. The
+crossover passed to varpro.set_thread_budget is the smallest block work
+(M*n^2) at which more than one BLAS thread wins.
+
+    python bench_threads.py [cores] [n_blocks]
+"""
+import sys
+import time
+import numpy as np
+import varpro
+
+
+def time_split(blocks, params, work, cores, blas, repeat=5):
+    # a crossover just under work/blas forces exactly `blas` BLAS threads,
+    # as long as there are enough blocks to fill cores/blas workers
+    varpro.set_thread_budget(cores, (1. - 1e-9)*work/blas)
+    best = np.inf
+    for _ in range(repeat):
+        start = time.perf_counter()
+        varpro.update_blocks(blocks, params, True)
+        best = min(best, time.perf_counter() - start)
+    return best
+
+
+def make_blocks(M, n, n_blocks):
+    rates = np.linspace(0.2, 5., n - 1)
+    t = np.linspace(-1., 10., M)
+    y = varpro.arma.Vec(np.exp(-np.outer(t.clip(0.), rates)).sum(axis=1))
+    t = varpro.arma.Vec(t)
+    p = np.concatenate([rates, [0.1, 0.]])
+
+    blocks = [varpro.irf_exp_model(y, t, n - 1) for i in range(n_blocks)]
+    params = [varpro.arma.Vec(p) for i in range(n_blocks)]
+    return blocks, params
+
+
+def main():
+    cores = int(sys.argv[1]) if len(sys.argv) > 1 else 0
+    n_blocks = int(sys.argv[2]) if len(sys.argv) > 2 else 64
+    varpro.set_thread_budget(cores)
+    cores = varpro.thread_budget()[0]
+    n_blocks = max(n_blocks, cores)
+
+    splits = [b for b in range(1, cores + 1) if cores % b == 0]
+    print("{:>10} {:>4} {:>12} {:>10} {:>12}".format("M", "n", "work", "best BLAS", "time [s]"))
+    crossover = np.inf
+    for n in [2, 4, 8, 16]:
+        for M in [10**3, 10**4, 10**5]:
+            blocks, params = make_blocks(M, n, n_blocks)
+            work = M*float(n)**2
+
+            times = [time_split(blocks, params, work, cores, b) for b in splits]
+            best = splits[int(np.argmin(times))]
+            if best > 1:
+                crossover = min(crossover, work)
+            print("{:>10} {:>4} {:>12.3g} {:>10} {:>12.4g}".format(M, n, work, best, min(times)))
+
+    print("suggested crossover:", crossover)
+
+
+if __name__ == "__main__":
+    main()
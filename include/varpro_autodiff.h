@@ -0,0 +1,200 @@
+#pragma once
+
+#include <armadillo>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+// Scalar types used by ad_model to evaluate a user supplied basis function.
+//
+// The same templated basis function is instantiated three times:
+//  - with double, to fill the model matrix Amat
+//  - with dual<N>, to fill the jacobian mjac by forward-mode differentiation
+//  - with pattern, at every time point once at construction, to find the
+//    jidx sparsity pattern
+//
+// Basis functions should call math functions unqualified after a
+// `using std::exp;` (etc.) so that argument dependent lookup picks the
+// overloads defined here. They may branch on t but not on parameter values.
+namespace varpro_ad {
+
+// value and gradient with respect to N nonlinear parameters
+template <arma::uword N>
+struct dual
+{
+    double v;
+    std::array<double, N> d;
+
+    dual(): v(0.) { d.fill(0.); }
+    dual(double x): v(x) { d.fill(0.); }
+
+    // independent variable k with value x
+    static dual seed(double x, arma::uword k)
+    {
+        dual r(x);
+        r.d[k] = 1.;
+        return r;
+    }
+
+    dual& operator+=(const dual& b)
+    {
+        v += b.v;
+        for(arma::uword k = 0; k < N; ++k) d[k] += b.d[k];
+        return *this;
+    }
+
+    dual& operator-=(const dual& b)
+    {
+        v -= b.v;
+        for(arma::uword k = 0; k < N; ++k) d[k] -= b.d[k];
+        return *this;
+    }
+
+    dual& operator*=(const dual& b)
+    {
+        for(arma::uword k = 0; k < N; ++k) d[k] = d[k]*b.v + v*b.d[k];
+        v *= b.v;
+        return *this;
+    }
+
+    dual& operator/=(const dual& b)
+    {
+        double inv = 1./b.v;
+        v *= inv;
+        for(arma::uword k = 0; k < N; ++k) d[k] = (d[k] - v*b.d[k])*inv;
+        return *this;
+    }
+};
+
+// apply f to x, given f(x.v) and f'(x.v)
+template <arma::uword N>
+inline dual<N> chain(const dual<N>& x, double f, double df)
+{
+    dual<N> r(f);
+    for(arma::uword k = 0; k < N; ++k) r.d[k] = df*x.d[k];
+    return r;
+}
+
+template <arma::uword N>
+inline dual<N> operator-(const dual<N>& a) { return chain(a, -a.v, -1.); }
+
+template <arma::uword N>
+inline dual<N> operator+(dual<N> a, const dual<N>& b) { return a += b; }
+template <arma::uword N>
+inline dual<N> operator+(dual<N> a, double b) { a.v += b; return a; }
+template <arma::uword N>
+inline dual<N> operator+(double a, dual<N> b) { b.v += a; return b; }
+
+template <arma::uword N>
+inline dual<N> operator-(dual<N> a, const dual<N>& b) { return a -= b; }
+template <arma::uword N>
+inline dual<N> operator-(dual<N> a, double b) { a.v -= b; return a; }
+template <arma::uword N>
+inline dual<N> operator-(double a, const dual<N>& b) { return chain(b, a - b.v, -1.); }
+
+template <arma::uword N>
+inline dual<N> operator*(dual<N> a, const dual<N>& b) { return a *= b; }
+template <arma::uword N>
+inline dual<N> operator*(const dual<N>& a, double b) { return chain(a, a.v*b, b); }
+template <arma::uword N>
+inline dual<N> operator*(double a, const dual<N>& b) { return chain(b, a*b.v, a); }
+
+template <arma::uword N>
+inline dual<N> operator/(dual<N> a, const dual<N>& b) { return a /= b; }
+template <arma::uword N>
+inline dual<N> operator/(const dual<N>& a, double b) { return chain(a, a.v/b, 1./b); }
+template <arma::uword N>
+inline dual<N> operator/(double a, const dual<N>& b)
+{
+    double r = a/b.v;
+    return chain(b, r, -r/b.v);
+}
+
+template <arma::uword N>
+inline dual<N> exp(const dual<N>& x)
+{
+    double e = std::exp(x.v);
+    return chain(x, e, e);
+}
+
+template <arma::uword N>
+inline dual<N> log(const dual<N>& x) { return chain(x, std::log(x.v), 1./x.v); }
+
+template <arma::uword N>
+inline dual<N> sqrt(const dual<N>& x)
+{
+    double s = std::sqrt(x.v);
+    return chain(x, s, 0.5/s);
+}
+
+template <arma::uword N>
+inline dual<N> pow(const dual<N>& x, double n)
+{
+    double p = std::pow(x.v, n - 1.);
+    return chain(x, p*x.v, n*p);
+}
+
+template <arma::uword N>
+inline dual<N> sin(const dual<N>& x) { return chain(x, std::sin(x.v), std::cos(x.v)); }
+
+template <arma::uword N>
+inline dual<N> cos(const dual<N>& x) { return chain(x, std::cos(x.v), -std::sin(x.v)); }
+
+template <arma::uword N>
+inline dual<N> erf(const dual<N>& x)
+{
+    const double two_sqrtpi = 1.1283791670955126; // 2/sqrt(pi)
+    return chain(x, std::erf(x.v), two_sqrtpi*std::exp(-x.v*x.v));
+}
+
+template <arma::uword N>
+inline dual<N> erfc(const dual<N>& x)
+{
+    const double two_sqrtpi = 1.1283791670955126; // 2/sqrt(pi)
+    return chain(x, std::erfc(x.v), -two_sqrtpi*std::exp(-x.v*x.v));
+}
+
+// structural dependence of a value on the nonlinear parameters; bit k is set
+// if the value depends on parameter k
+struct pattern
+{
+    std::uint64_t deps;
+
+    pattern(): deps(0) {}
+    pattern(double): deps(0) {}
+
+    static pattern seed(double, arma::uword k)
+    {
+        pattern r;
+        r.deps = std::uint64_t(1) << k;
+        return r;
+    }
+};
+
+inline pattern merge(const pattern& a, const pattern& b)
+{
+    pattern r;
+    r.deps = a.deps | b.deps;
+    return r;
+}
+
+inline pattern operator-(const pattern& a) { return a; }
+inline pattern operator+(const pattern& a, const pattern& b) { return merge(a, b); }
+inline pattern operator-(const pattern& a, const pattern& b) { return merge(a, b); }
+inline pattern operator*(const pattern& a, const pattern& b) { return merge(a, b); }
+inline pattern operator/(const pattern& a, const pattern& b) { return merge(a, b); }
+inline pattern& operator+=(pattern& a, const pattern& b) { return a = merge(a, b); }
+inline pattern& operator-=(pattern& a, const pattern& b) { return a = merge(a, b); }
+inline pattern& operator*=(pattern& a, const pattern& b) { return a = merge(a, b); }
+inline pattern& operator/=(pattern& a, const pattern& b) { return a = merge(a, b); }
+
+inline pattern exp(const pattern& x) { return x; }
+inline pattern log(const pattern& x) { return x; }
+inline pattern sqrt(const pattern& x) { return x; }
+inline pattern pow(const pattern& x, double) { return x; }
+inline pattern sin(const pattern& x) { return x; }
+inline pattern cos(const pattern& x) { return x; }
+inline pattern erf(const pattern& x) { return x; }
+inline pattern erfc(const pattern& x) { return x; }
+
+} // namespace varpro_ad
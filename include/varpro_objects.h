@@ -6,6 +6,7 @@
 #include <vector>
 #include <tuple>
 #include "spdlog/spdlog.h"
+#include "varpro_autodiff.h"
 
 typedef std::tuple<arma::uword, bool> dof_spec; // number of degrees of freedom, whether model includes intercept term 
 
@@ -36,10 +37,21 @@ struct fit_report
                dof_spec dof, 
                std::vector<const char*> param_labels,
                double alpha);
+    fit_report() {} // empty report, filled in field by field when unpickling
 
     std::string printable_summary(unsigned int width = 80) const;
 };
 
+// what a pickled block carries besides its constructor inputs; the rest of
+// the model state is rebuilt from alpha. J is kept because it may be from an
+// earlier step than alpha.
+struct block_state
+{
+    arma::vec alpha, beta; // nonlinear and linear parameters
+    arma::mat J;
+    arma::uword feval, jeval;
+};
+
 class response_block 
 {
 public:
@@ -51,10 +63,20 @@ public:
     const std::tuple<arma::vec, arma::vec, arma::mat> get_yrJ() const;
 
     const std::tuple<arma::vec, arma::vec> get_params() const;
-    const arma::vec get_target() const;
+    const arma::vec& get_target() const;
     const std::tuple<arma::mat, arma::umat, arma::mat, 
           arma::mat, arma::mat, arma::mat> get_internal() const;
     const std::tuple<arma::mat, arma::vec, arma::mat> get_svd() const;
+    // number of measurements and of basis functions
+    const std::tuple<arma::uword, arma::uword> get_size() const;
+
+    // block_state members by reference, so pickling does not copy them
+    const arma::vec& state_alpha() const { return alpha; }
+    const arma::vec& state_beta() const { return beta; }
+    const arma::mat& state_jacobian() const { return J; }
+    const std::tuple<arma::uword, arma::uword> get_counters() const;
+    // moves st into the block after rebuilding the model at st.alpha
+    void set_state(block_state&& st);
 
     virtual const fit_report get_fit_report(double alpha) const = 0;
 
@@ -68,6 +90,10 @@ protected:
     virtual void evaluate_model(const arma::vec& p) = 0;
     virtual void evaluate_jacobian(const arma::vec& p) = 0;
 
+    // assemble a fit_report from the current linear and nonlinear parameters
+    const fit_report make_fit_report(const char *model_name, dof_spec model_dof,
+            std::vector<const char*> labels, double alpha) const;
+
     const arma::vec y; // measured response
     arma::uword M; // number of measurements
     arma::vec yh; // estimated response
@@ -96,6 +122,7 @@ public:
     explicit exp_model(const arma::vec& m, const arma::vec& t);
     virtual ~exp_model();
     virtual const fit_report get_fit_report(double alpha = 5.) const;
+    const arma::vec& get_time() const { return tvec; }
 
     static const char *name;
     static const dof_spec dof;
@@ -108,3 +135,177 @@ protected:
 
 private:
 };
+
+// exponentials convolved with a gaussian instrument response function of
+// width sigma centered at t0; nonlinear parameters are [k1..kn, sigma, t0]
+class irf_exp_model : public response_block
+{
+public:
+    explicit irf_exp_model(const arma::vec& m, const arma::vec& t, 
+            arma::uword n_rates = 1);
+    virtual ~irf_exp_model();
+    virtual const fit_report get_fit_report(double alpha = 5.) const;
+    const arma::vec& get_time() const { return tvec; }
+    arma::uword get_nrates() const { return nrates; }
+
+    static const char *name;
+
+protected:
+    virtual void evaluate_model(const arma::vec&p);
+    virtual void evaluate_jacobian(const arma::vec&p);
+    const arma::vec tvec;
+    const arma::uword nrates;
+    std::vector<std::string> plabels;
+
+private:
+};
+
+// Response block whose basis functions are written once, as a template over
+// the scalar type, in the Model class (CRTP). Amat, mjac and the jidx pattern
+// are all generated from
+//
+//   template <typename T>
+//   static void basis(const std::array<T, NParams>& p, double t,
+//                     std::array<T, NBasis>& out);
+//
+// See varpro_autodiff.h for the restrictions on the body of basis().
+template <typename Model, arma::uword NBasis, arma::uword NParams>
+class ad_model : public response_block
+{
+public:
+    explicit ad_model(const arma::vec& m, const arma::vec& t):
+        response_block(m),
+        tvec(t)
+    {
+        static_assert(NParams <= 64, "ad_model supports at most 64 parameters");
+        static_assert(std::tuple_size<decltype(Model::param_labels)>::value == NBasis + NParams,
+                "param_labels needs one label per basis function and nonlinear parameter");
+        log->debug("in ad_model::ad_model()");
+
+        if(m.n_elem != t.n_elem)
+            throw std::runtime_error("y and t vector lengths must match");
+
+        Amat.set_size(M, NBasis);
+        init_jidx();
+        mjac.set_size(M, jidx.n_cols);
+        log->debug("jidx initialized to \n{}", jidx);
+    }
+
+    virtual ~ad_model() {}
+
+    virtual const fit_report get_fit_report(double alpha = 5.) const
+    {
+        std::vector<const char *> labels(Model::param_labels.begin(),
+                Model::param_labels.end());
+        return make_fit_report(Model::name, Model::dof, labels, alpha);
+    }
+
+    const arma::vec& get_time() const { return tvec; }
+
+protected:
+    typedef varpro_ad::dual<NParams> dual_t;
+
+    virtual void evaluate_model(const arma::vec& p)
+    {
+        log->debug("in ad_model::evaluate_model()");
+        std::array<double, NParams> q;
+        load_params(p, q);
+
+        std::array<double, NBasis> out;
+        for(arma::uword i = 0; i < M; ++i) {
+            Model::basis(q, tvec(i), out);
+            for(arma::uword j = 0; j < NBasis; ++j)
+                Amat(i, j) = out[j];
+        }
+        log->debug("done updating Amat");
+    }
+
+    virtual void evaluate_jacobian(const arma::vec& p)
+    {
+        log->debug("in ad_model::evaluate_jacobian()");
+        std::array<dual_t, NParams> q;
+        load_params(p, q);
+
+        const arma::uword nnz = jidx.n_cols;
+        std::array<dual_t, NBasis> out;
+        for(arma::uword i = 0; i < M; ++i) {
+            Model::basis(q, tvec(i), out);
+            for(arma::uword k = 0; k < nnz; ++k)
+                mjac(i, k) = out[jidx(0, k)].d[jidx(1, k)];
+        }
+        log->debug("done updating mjac");
+    }
+
+    const arma::vec tvec;
+
+private:
+    template <typename T>
+    void load_params(const arma::vec& p, std::array<T, NParams>& q) const
+    {
+        if(p.n_elem != NParams)
+            throw std::runtime_error("wrong number of nonlinear parameters");
+
+        for(arma::uword k = 0; k < NParams; ++k)
+            q[k] = T::seed(p(k), k);
+    }
+
+    void load_params(const arma::vec& p, std::array<double, NParams>& q) const
+    {
+        if(p.n_elem != NParams)
+            throw std::runtime_error("wrong number of nonlinear parameters");
+
+        for(arma::uword k = 0; k < NParams; ++k)
+            q[k] = p(k);
+    }
+
+    // propagate the dependence structure through basis() once; every
+    // (basis, parameter) pair that is connected gets a column in mjac
+    void init_jidx()
+    {
+        std::array<varpro_ad::pattern, NParams> q;
+        for(arma::uword k = 0; k < NParams; ++k)
+            q[k] = varpro_ad::pattern::seed(0., k);
+
+        // the basis may branch on t, so take the union over every time point
+        std::array<std::uint64_t, NBasis> deps;
+        deps.fill(0);
+        std::array<varpro_ad::pattern, NBasis> out;
+        for(arma::uword i = 0; i < tvec.n_elem; ++i) {
+            Model::basis(q, tvec(i), out);
+            for(arma::uword j = 0; j < NBasis; ++j)
+                deps[j] |= out[j].deps;
+        }
+
+        std::vector<arma::uword> nz;
+        for(arma::uword j = 0; j < NBasis; ++j)
+            for(arma::uword k = 0; k < NParams; ++k)
+                if(deps[j] & (std::uint64_t(1) << k)) {
+                    nz.push_back(j);
+                    nz.push_back(k);
+                }
+
+        jidx.set_size(2, nz.size()/2);
+        std::copy(nz.begin(), nz.end(), jidx.begin());
+    }
+};
+
+// sum of two exponentials with an intercept, defined through ad_model
+class biexp_model : public ad_model<biexp_model, 3, 2>
+{
+public:
+    explicit biexp_model(const arma::vec& m, const arma::vec& t);
+    virtual ~biexp_model();
+
+    static const char *name;
+    static const dof_spec dof;
+    static const std::array<const char *, 5> param_labels;
+
+    template <typename T>
+    static void basis(const std::array<T, 2>& p, double t, std::array<T, 3>& out)
+    {
+        using std::exp;
+        out[0] = T(1.);
+        out[1] = exp(-t*p[0]);
+        out[2] = exp(-t*p[1]);
+    }
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <armadillo>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "varpro_objects.h"
+
+// Splits a fixed core budget between BLAS threads inside a block (svd_econ
+// and the projection products) and blocks updated concurrently, so that the
+// two kinds of parallelism never oversubscribe the machine.
+//
+// A block's work is estimated as M*n^2 for an M x n model matrix. Blocks below
+// the crossover get a single BLAS thread and are spread over the budget; each
+// multiple of the crossover buys one more BLAS thread per block. Cores left
+// over once every block has a worker go to BLAS. Builds without
+// VARPRO_USE_MKL cannot set BLAS threads, so they only split across blocks.
+//
+// Workers are kept between update_blocks calls and pinned once; the pool is
+// rebuilt when configure() is called or the plan changes.
+class thread_budget
+{
+public:
+    static thread_budget& instance();
+
+    // cores == 0 uses every hardware thread
+    void configure(unsigned int cores, double crossover, bool pin);
+    const std::tuple<unsigned int, double, bool> get_config() const;
+
+    // (concurrent blocks, BLAS threads per block)
+    const std::tuple<unsigned int, unsigned int> plan(arma::uword n_blocks, double work) const;
+
+    // update_model on every block, with params[i] going to blocks[i]
+    void update_blocks(const std::vector<response_block*>& blocks,
+            const std::vector<arma::vec>& params, bool update_jac);
+
+    // whether this build sets the BLAS thread count
+    static bool controls_blas();
+
+    // blocks are updated without locking, so each may appear only once
+    static void check_distinct(const std::vector<response_block*>& blocks);
+    static double block_work(const response_block& b);
+    static const double default_crossover;
+
+private:
+    thread_budget();
+
+    void start_pool(unsigned int workers, unsigned int blas, bool pinned);
+    void stop_pool();
+    void worker_loop(unsigned int w, unsigned long seen);
+
+    mutable std::mutex lock; // guards the configuration
+    unsigned int cores;
+    double crossover;
+    bool pin;
+
+    std::mutex run_lock; // one update_blocks or configure at a time
+
+    std::mutex pool_lock; // guards everything below
+    std::condition_variable pool_cv, done_cv;
+    std::vector<std::thread> pool;
+    std::vector<unsigned int> pool_cpus; // empty unless pinned
+    unsigned int pool_blas;
+    bool pool_pin; // pinning requested, even if skipped
+    std::function<void(unsigned int)> job;
+    unsigned long generation;
+    unsigned int running;
+    bool stopping;
+};
@@ -16,5 +16,9 @@ py::buffer_info umat_buffer(arma::umat &m);
 void vec_np_init(arma::vec &v, py::array inp);
 void mat_np_init(arma::mat &m, py::array inp);
 void umat_np_init(arma::umat &m, py::array inp);
+void vec_pickle_init(arma::vec &v, py::buffer inp, arma::uword n_rows);
+void mat_pickle_init(arma::mat &m, py::buffer inp, arma::uword n_rows, arma::uword n_cols);
+void umat_pickle_init(arma::umat &m, py::buffer inp, arma::uword n_rows, arma::uword n_cols);
+py::object pickle_buffer(py::object self, const void *ptr, size_t nbytes, int protocol);
 
 //np_yJ package_yJ(const response_block&);
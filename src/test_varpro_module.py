@@ -1,5 +1,7 @@
 import varpro
 import numpy as np
+import pickle
+import pytest
 
 def test_import():
     assert "Hello, world!" == varpro.hello(), "wrong string returned"
@@ -65,5 +67,132 @@ def test_arma_mat_noncontiguous():
     with pytest.raises(Exception):
         z = varpro.arma.Mat(y)
 
+def check_jacobian(m, p, atol, h=1e-6):
+    """compare every mjac column against a forward difference of Amat"""
+    m.update_model(varpro.arma.Vec(p), True)
+    A, jidx, mjac = [np.asarray(x) for x in m._internal[:3]]
+
+    for i in range(jidx.shape[1]):
+        basis_no, param_no = jidx[:, i]
+        dp = p.copy()
+        dp[param_no] += h
+        m.update_model(varpro.arma.Vec(dp))
+        dA = np.asarray(m._internal[0])
+        fd = (dA[:, basis_no] - A[:, basis_no])/h
+        assert np.allclose(mjac[:, i], fd, atol=atol), "jacobian mismatch"
+
+    return jidx
+
+def irf_exp_reference(tau, k, sigma, n=400001):
+    """exp(-k t) for t > 0 convolved numerically with a unit area gaussian"""
+    out = []
+    for x in tau:
+        u = np.linspace(0., max(x, 0.) + 12.*sigma + 40./k, n)
+        e = -k*u - 0.5*((x - u)/sigma)**2
+        f = np.exp(e - e.max())
+        area = (u[1] - u[0])*(f.sum() - 0.5*(f[0] + f[-1]))
+        out.append(np.exp(e.max())*area/(sigma*np.sqrt(2.*np.pi)))
+    return np.array(out)
+
+def test_biexp_model_jacobian():
+    t = np.linspace(0., 5., 50)
+    y = 1. + 2.*np.exp(-0.5*t) + 0.5*np.exp(-3.*t)
+    m = varpro.biexp_model(varpro.arma.Vec(y), varpro.arma.Vec(t))
+
+    jidx = check_jacobian(m, np.array([0.7, 2.5]), 1e-5)
+    assert jidx.shape == (2, 2), "intercept column should not be in jidx"
+
+def test_irf_exp_model_jacobian():
+    t = np.linspace(-1., 10., 200)
+    y = np.exp(-0.8*t)*(t > 0)
+    m = varpro.irf_exp_model(varpro.arma.Vec(y), varpro.arma.Vec(t), 2)
+
+    jidx = check_jacobian(m, np.array([0.5, 2., 0.2, 0.1]), 1e-4)
+    assert jidx.shape == (2, 6), "sigma and t0 should share decay columns"
+
+    # an LM step may take sigma negative; the model is even in sigma
+    check_jacobian(m, np.array([0.5, 2., -0.2, 0.1]), 1e-4)
+
+def test_irf_exp_model_values():
+    # t = -1.6 and -1.5 put the erfcx argument above 10, on the continued
+    # fraction branch
+    t = np.concatenate([[-1.6, -1.5], np.linspace(-1., 10., 60)])
+    k, sigma, t0 = 2., 0.1, 0.
+    m = varpro.irf_exp_model(varpro.arma.Vec(np.exp(-k*t)), varpro.arma.Vec(t))
+
+    ref = irf_exp_reference(t - t0, k, sigma)
+    for s in [sigma, -sigma]:
+        m.update_model(varpro.arma.Vec(np.array([k, s, t0])))
+        A = np.asarray(m._internal[0])
+        assert np.allclose(A[:, 1], ref, rtol=1e-4, atol=0.), "wrong convolved exponential"
+
+def test_arma_mat_pickle_out_of_band():
+    x = varpro.arma.Mat(np.random.uniform(size=(10, 5)))
+    buffers = []
+    data = pickle.dumps(x, protocol=5, buffer_callback=buffers.append)
+    y = pickle.loads(data, buffers=buffers)
+
+    assert len(buffers) == 1, "array should be sent out-of-band"
+    assert np.allclose(np.asarray(x), np.asarray(y)), "roundtrip failed"
+
+def test_exp_model_pickle():
+    t = np.linspace(0., 5., 50)
+    y = 1. + 2.*np.exp(-0.5*t)
+    m = varpro.exp_model(varpro.arma.Vec(y), varpro.arma.Vec(t))
+    m.update_model(varpro.arma.Vec(np.array([0.6])), True)
+    # leaves the jacobian from the previous step, which must survive as is
+    m.update_model(varpro.arma.Vec(np.array([0.4])))
+
+    buffers = []
+    data = pickle.dumps(m, protocol=5, buffer_callback=buffers.append)
+    assert len(buffers) > 0, "arrays should be sent out-of-band"
+    blocks = [pickle.loads(data, buffers=buffers)]
+    blocks.append(pickle.loads(pickle.dumps(m, protocol=2)))
+
+    for n in blocks:
+        for a, b in zip(m.fit, n.fit):
+            assert np.allclose(np.asarray(a), np.asarray(b)), "parameters lost"
+        assert np.allclose(np.asarray(m.yrJ[2]), np.asarray(n.yrJ[2])), "jacobian lost"
+
+    r = m.fit_report()
+    s = pickle.loads(pickle.dumps(r, protocol=5))
+    assert r.labels == s.labels, "labels lost"
+    assert np.allclose(np.asarray(r.cor), np.asarray(s.cor)), "correlation lost"
+
+def test_thread_plan():
+    cores, crossover, pin = varpro.thread_budget()
+    varpro.set_thread_budget(8, 1e6)
+
+    assert varpro.thread_plan(100, 1e3) == (8, 1), "small blocks should not use BLAS threads"
+    if varpro.controls_blas():
+        assert varpro.thread_plan(100, 2e6) == (4, 2), "budget oversubscribed"
+        assert varpro.thread_plan(3, 1e9) == (1, 8), "large block should get every core"
+        assert varpro.thread_plan(1, 2e6) == (1, 8), "single block should get every core"
+        assert varpro.thread_plan(2, 3e6) == (2, 4), "leftover cores should go to BLAS"
+    else:
+        # BLAS threads are not ours to set, so only blocks run in parallel
+        assert varpro.thread_plan(100, 2e6) == (8, 1), "blocks should use every core"
+        assert varpro.thread_plan(3, 1e9) == (3, 1), "one worker per block"
+        assert varpro.thread_plan(1, 2e6) == (1, 1), "BLAS threads requested without control"
+
+    varpro.set_thread_budget(cores, crossover, pin)
+
+def test_update_blocks():
+    t = varpro.arma.Vec(np.linspace(0., 5., 50))
+    ys, blocks, params = [], [], []
+    for k in np.linspace(0.5, 2., 6):
+        ys.append(varpro.arma.Vec(1. + 2.*np.exp(-k*np.asarray(t))))
+        blocks.append(varpro.exp_model(ys[-1], t))
+        params.append(varpro.arma.Vec(np.array([k + 0.1])))
+
+    with pytest.raises(Exception):
+        varpro.update_blocks([blocks[0], blocks[0]], params[:2])
+
+    varpro.update_blocks(blocks, params, True)
+    for y, b, p in zip(ys, blocks, params):
+        c = varpro.exp_model(y, t)
+        c.update_model(p, True)
+        assert np.allclose(np.asarray(b.yrJ[2]), np.asarray(c.yrJ[2])), "parallel update differs"
+
 if __name__ == "__main__":
     test_import()
@@ -6,12 +6,99 @@
 #include "pybind11/stl.h"
 #include "varpro_objects.h"
 #include "varpro_util.h"
+#include "varpro_threads.h"
 #include "spdlog/spdlog.h"
 
 namespace py  = pybind11;
 
+// Pickled blocks are (constructor arguments, block state) pairs. The state
+// arrays are references into the block, so under protocol 5 they go
+// out-of-band without being copied.
+py::tuple pack_state(py::object self)
+{
+    const response_block &m = self.cast<const response_block &>();
+    auto policy = py::return_value_policy::reference_internal;
+    auto counters = m.get_counters();
+    return py::make_tuple(py::cast(m.state_alpha(), policy, self),
+            py::cast(m.state_beta(), policy, self),
+            py::cast(m.state_jacobian(), policy, self),
+            std::get<0>(counters), std::get<1>(counters));
+}
+
+void unpack_state(response_block &m, py::tuple t)
+{
+    if(t.size() != 5)
+        throw std::runtime_error("invalid response_block state");
+
+    // the unpickled arrays are temporaries, so their memory is moved in
+    block_state st;
+    st.alpha = std::move(t[0].cast<arma::vec &>());
+    st.beta = std::move(t[1].cast<arma::vec &>());
+    st.J = std::move(t[2].cast<arma::mat &>());
+    st.feval = t[3].cast<arma::uword>();
+    st.jeval = t[4].cast<arma::uword>();
+    m.set_state(std::move(st));
+}
+
+// constructor arguments of a pickled block, by reference like pack_state;
+// models whose constructor takes more than (y, t) specialize both
+template <class B>
+py::tuple block_args(py::object self)
+{
+    const B &m = self.cast<const B &>();
+    auto policy = py::return_value_policy::reference_internal;
+    return py::make_tuple(py::cast(m.get_target(), policy, self),
+            py::cast(m.get_time(), policy, self));
+}
+
+template <class B>
+void construct_block(B &m, py::tuple args)
+{
+    new (&m) B(args[0].cast<const arma::vec &>(), args[1].cast<const arma::vec &>());
+}
+
+template <>
+py::tuple block_args<irf_exp_model>(py::object self)
+{
+    const irf_exp_model &m = self.cast<const irf_exp_model &>();
+    auto policy = py::return_value_policy::reference_internal;
+    return py::make_tuple(py::cast(m.get_target(), policy, self),
+            py::cast(m.get_time(), policy, self), m.get_nrates());
+}
+
+template <>
+void construct_block<irf_exp_model>(irf_exp_model &m, py::tuple args)
+{
+    new (&m) irf_exp_model(args[0].cast<const arma::vec &>(), args[1].cast<const arma::vec &>(),
+            args[2].cast<arma::uword>());
+}
+
+// bindings shared by every response block; the caller adds the constructor
+template <class B>
+py::class_<B> bind_block(py::module &m, py::class_<response_block> &rb)
+{
+    py::class_<B> cls(m, B::name, rb);
+    cls.def_property_readonly("yrJ", [](const B& m){return m.get_yrJ();})
+        .def_property_readonly("fit", [](const B& m){return m.get_params();})
+        .def_property_readonly("target", [](const B& m){return m.get_target();})
+        .def_property_readonly("_internal", [](const B& m){return m.get_internal();})
+        .def_property_readonly("_svd", [](const B& m){return m.get_svd();})
+        .def("update_model", &B::update_model, 
+            "update the model", py::arg("p0"), py::arg("update_jac") = false)
+        .def("fit_report", [](const B& m, double alpha){return m.get_fit_report(alpha);}, py::arg("alpha") = 5.)
+        .def("__getstate__", [](py::object self){
+                return py::make_tuple(block_args<B>(self), pack_state(self));})
+        .def("__setstate__", [](B& m, py::tuple t){
+                if(t.size() != 2)
+                    throw std::runtime_error("invalid response_block state");
+
+                construct_block(m, t[0].cast<py::tuple>());
+                unpack_state(m, t[1].cast<py::tuple>());});
+    return cls;
+}
+
 PYBIND11_PLUGIN(varpro) {
-    auto console = spdlog::stdout_logger_st("varpro");
+    auto console = spdlog::stdout_logger_mt("varpro");
     console->set_level(spdlog::level::info);
     console->debug("initializing module varpro");
 
@@ -19,6 +106,29 @@ PYBIND11_PLUGIN(varpro) {
 
     m.def("hello", &hello, "return a string containing a greeting");
 
+    m.def("set_thread_budget", 
+            [](unsigned int cores, double crossover, bool pin)
+            {thread_budget::instance().configure(cores, crossover, pin);},
+            "set the total cores shared by BLAS and block-level threads",
+            py::arg("cores") = 0, py::arg("crossover") = thread_budget::default_crossover, 
+            py::arg("pin") = false);
+    m.def("thread_budget", [](){return thread_budget::instance().get_config();},
+            "return the (cores, crossover, pin) threading policy");
+    m.def("controls_blas", &thread_budget::controls_blas,
+            "whether this build sets the BLAS thread count (VARPRO_USE_MKL)");
+    m.def("thread_plan", 
+            [](arma::uword n_blocks, double work){return thread_budget::instance().plan(n_blocks, work);},
+            "return (concurrent blocks, BLAS threads per block) for blocks of given work",
+            py::arg("n_blocks"), py::arg("work"));
+    m.def("update_blocks", 
+            [](std::vector<response_block*> blocks, std::vector<arma::vec> params, bool update_jac)
+            {
+                py::gil_scoped_release release;
+                thread_budget::instance().update_blocks(blocks, params, update_jac);
+            },
+            "update blocks concurrently within the thread budget; each block may appear once",
+            py::arg("blocks"), py::arg("params"), py::arg("update_jac") = false);
+
     py::class_<fit_report>(m, "fit_report")
         .def_property_readonly("labels", [](const fit_report &m){return m.labels;})
         .def_property_readonly("parameters", 
@@ -41,25 +151,59 @@ PYBIND11_PLUGIN(varpro) {
                 [](const fit_report &m){return m.cor;})
         .def("__repr__", 
                 [](const fit_report &m, unsigned int width)
-                {return m.printable_summary(width);}, py::arg("width") = 80);
+                {return m.printable_summary(width);}, py::arg("width") = 80)
+        .def("__getstate__", [](const fit_report &m){
+                return py::make_tuple(m.model_name, 
+                    py::make_tuple(m.chisqr, m.rms, m.rme, m.alpha, m.cond, m.mdof, m.ddof),
+                    m.parameters, m.labels, m.se, m.cor, m.tstat, m.marginal_ci,
+                    m.wresid, m.tresid);})
+        .def("__setstate__", [](fit_report &m, py::tuple t){
+                if(t.size() != 10)
+                    throw std::runtime_error("invalid fit_report state");
+
+                new (&m) fit_report();
+                m.model_name = t[0].cast<std::string>();
+                py::tuple s = t[1].cast<py::tuple>();
+                m.chisqr = s[0].cast<double>();
+                m.rms = s[1].cast<double>();
+                m.rme = s[2].cast<double>();
+                m.alpha = s[3].cast<double>();
+                m.cond = s[4].cast<double>();
+                m.mdof = s[5].cast<arma::uword>();
+                m.ddof = s[6].cast<arma::uword>();
+                m.parameters = t[2].cast<arma::vec>();
+                m.labels = t[3].cast<std::vector<std::string>>();
+                m.se = t[4].cast<arma::vec>();
+                m.cor = t[5].cast<arma::mat>();
+                m.tstat = t[6].cast<arma::vec>();
+                m.marginal_ci = t[7].cast<std::vector<std::tuple<double, double, double>>>();
+                m.wresid = t[8].cast<arma::vec>();
+                m.tresid = t[9].cast<arma::vec>();});
 
     py::class_<response_block> rb(m, "_response_block");
 
-    py::class_<exp_model>(m, exp_model::name, rb)
-        .def(py::init<const arma::vec, const arma::vec>())
-        .def_property_readonly("yrJ", [](const exp_model& m){return m.get_yrJ();})
-        .def_property_readonly("fit", [](const exp_model& m){return m.get_params();})
-        .def_property_readonly("target", [](const exp_model& m){return m.get_target();})
-        .def_property_readonly("_internal", [](const exp_model& m){return m.get_internal();})
-        .def_property_readonly("_svd", [](const exp_model& m){return m.get_svd();})
-        .def("update_model", &exp_model::update_model, 
-            "update the model", py::arg("p0"), py::arg("update_jac") = false)
-        .def("fit_report", [](const exp_model& m, double alpha){return m.get_fit_report(alpha);}, py::arg("alpha") = 5.);
+    bind_block<exp_model>(m, rb)
+        .def(py::init<const arma::vec, const arma::vec>());
+
+    bind_block<irf_exp_model>(m, rb)
+        .def(py::init<const arma::vec, const arma::vec, arma::uword>(),
+            py::arg("m"), py::arg("t"), py::arg("n_rates") = 1);
+
+    bind_block<biexp_model>(m, rb)
+        .def(py::init<const arma::vec, const arma::vec>());
 
     py::module arma_mod = m.def_submodule("arma", "Python binding to armadillo types");
+    // pickle looks classes up through sys.modules by their __module__
+    py::module::import("sys").attr("modules").attr("__setitem__")("varpro.arma", arma_mod);
     py::class_<arma::vec>(arma_mod, "Vec")
         .def(py::init<const arma::uword>())
         .def("__init__", &vec_np_init)
+        .def("__init__", &vec_pickle_init)
+        .def("__reduce_ex__", [](py::object self, int protocol){
+                const arma::vec &a = self.cast<const arma::vec &>();
+                auto buf = pickle_buffer(self, a.memptr(), 
+                    sizeof(arma::vec::elem_type)*a.n_elem, protocol);
+                return py::make_tuple(self.attr("__class__"), py::make_tuple(buf, a.n_rows));})
         .def_property_readonly("shape", 
                 [](const arma::vec &a){return std::make_tuple(a.n_rows);})
         .def_property_readonly("n_elem", [](const arma::vec &a){return a.n_elem;})
@@ -73,6 +217,12 @@ PYBIND11_PLUGIN(varpro) {
     py::class_<arma::mat>(arma_mod, "Mat")
         .def(py::init<const arma::uword, const arma::uword>())
         .def("__init__", &mat_np_init)
+        .def("__init__", &mat_pickle_init)
+        .def("__reduce_ex__", [](py::object self, int protocol){
+                const arma::mat &a = self.cast<const arma::mat &>();
+                auto buf = pickle_buffer(self, a.memptr(), 
+                    sizeof(arma::mat::elem_type)*a.n_elem, protocol);
+                return py::make_tuple(self.attr("__class__"), py::make_tuple(buf, a.n_rows, a.n_cols));})
         .def_property_readonly("shape", 
                 [](const arma::mat &a){return std::make_tuple(a.n_rows, a.n_cols);})
         .def_property_readonly("n_elem", [](const arma::mat &a){return a.n_elem;})
@@ -86,6 +236,12 @@ PYBIND11_PLUGIN(varpro) {
     py::class_<arma::umat>(arma_mod, "uMat")
         .def(py::init<const arma::uword, const arma::uword>())
         .def("__init__", &umat_np_init)
+        .def("__init__", &umat_pickle_init)
+        .def("__reduce_ex__", [](py::object self, int protocol){
+                const arma::umat &a = self.cast<const arma::umat &>();
+                auto buf = pickle_buffer(self, a.memptr(), 
+                    sizeof(arma::umat::elem_type)*a.n_elem, protocol);
+                return py::make_tuple(self.attr("__class__"), py::make_tuple(buf, a.n_rows, a.n_cols));})
         .def_property_readonly("shape", 
                 [](const arma::umat &a){return std::make_tuple(a.n_rows, a.n_cols);})
         .def_property_readonly("n_elem", [](const arma::umat &a){return a.n_elem;})
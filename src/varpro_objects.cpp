@@ -209,7 +209,7 @@ const std::tuple<arma::vec, arma::vec, arma::mat> response_block::get_yrJ() cons
     return std::make_tuple(yh, resid, J); 
 }
 
-const arma::vec response_block::get_target() const
+const arma::vec& response_block::get_target() const
 {
     return y;
 }
@@ -224,6 +224,35 @@ const std::tuple<arma::mat, arma::vec, arma::mat> response_block::get_svd() cons
     return std::make_tuple(U, s, V);
 }
 
+const std::tuple<arma::uword, arma::uword> response_block::get_size() const
+{
+    return std::make_tuple(M, Amat.n_cols);
+}
+
+const std::tuple<arma::uword, arma::uword> response_block::get_counters() const
+{
+    return std::make_tuple(feval, jeval);
+}
+
+void response_block::set_state(block_state&& st)
+{
+    log->debug("in response_block::set_state()");
+
+    if(st.alpha.n_elem > 0)
+        update_model(st.alpha, false);
+
+    if(st.beta.n_elem != beta.n_elem || (st.J.n_elem > 0 && st.J.n_rows != M))
+        throw std::runtime_error("state does not match the block");
+
+    // beta is what update_model just computed; keep the pickled copy anyway so
+    // the restored block is bit for bit the original
+    alpha = std::move(st.alpha);
+    beta = std::move(st.beta);
+    J = std::move(st.J);
+    feval = st.feval;
+    jeval = st.jeval;
+}
+
 void response_block::update_model(const arma::vec p, bool update_jac)
 {
     using arma::mat;
@@ -317,6 +346,31 @@ const std::tuple<arma::mat, arma::umat, arma::mat,
     return std::make_tuple(Amat, jidx, mjac, dkc, dkrw, J);
 }
 
+const fit_report response_block::make_fit_report(const char *model_name,
+        dof_spec model_dof, std::vector<const char*> labels, double _a) const
+{
+    log->debug("generating fit_report");
+    // generate H matrix
+    arma::mat H;
+    H.set_size(M, Amat.n_cols + J.n_cols);
+
+    // copy over both the linear jacobian (which is just the model matrix)
+    // and the projected jacobian
+    std::copy(Amat.begin(), Amat.end(), H.begin());
+    std::copy(J.begin(), J.end(), H.begin_col(Amat.n_cols));
+
+    arma::vec params;
+    params.set_size(beta.n_elem + alpha.n_elem);
+    // Do the same with the parameters
+    std::copy(beta.cbegin(), beta.cend(), params.begin());
+    std::copy(alpha.cbegin(), alpha.cend(), params.begin_row(beta.n_elem));
+
+    log->debug("vector size: {}", labels.size());
+    log->debug("alpha parameter: {}", _a);
+
+    return fit_report(model_name, H, params, resid, model_dof, labels, _a);
+}
+
 exp_model::exp_model(const arma::vec& m, const arma::vec& t):
     response_block(m),
     tvec(t)
@@ -366,27 +420,159 @@ void exp_model::evaluate_jacobian(const arma::vec& p)
 
 const fit_report exp_model::get_fit_report(double _a) const
 {
-    log->debug("generating fit_report");
-    // generate H matrix
-    arma::mat H;
-    H.set_size(M, Amat.n_cols + J.n_cols);
+    std::vector <const char *> labels;
+    std::for_each(param_labels.begin(), param_labels.end(), 
+            [&](const char *s){labels.push_back(s);});
 
-    // copy over both the linear jacobian (which is just the model matrix)
-    // and the projected jacobian
-    std::copy(Amat.begin(), Amat.end(), H.begin());
-    std::copy(J.begin(), J.end(), H.begin_col(Amat.n_cols));
+    return make_fit_report(name, dof, labels, _a);
+}
 
-    arma::vec params;
-    params.set_size(beta.n_elem + alpha.n_elem);
-    // Do the same with the parameters
-    std::copy(beta.cbegin(), beta.cend(), params.begin());
-    std::copy(alpha.cbegin(), alpha.cend(), params.begin_row(beta.n_elem));
+static const double sqrt2 = 1.4142135623730951;
+static const double isqrtpi = 0.56418958354775628; // 1/sqrt(pi)
+
+// scaled complementary error function exp(x^2)*erfc(x) for x >= 0, using
+// the continued fraction for large x where erfc underflows; both forms agree
+// to machine precision at the switch
+static inline double erfcx(double x)
+{
+    if(x < 10.)
+        return std::exp(x*x)*std::erfc(x);
+
+    double f = x;
+    for(int n = 30; n > 0; --n)
+        f = x + 0.5*n/f;
+    return isqrtpi/f;
+}
+
+// exponential decay with rate k convolved with a unit area gaussian of width
+// sigma > 0, evaluated at tau = t - t0
+static inline double irf_exp(double tau, double k, double sigma)
+{
+    double x = (k*sigma*sigma - tau)/(sigma*sqrt2);
+    if(x >= 0.)
+        return 0.5*std::exp(-0.5*tau*tau/(sigma*sigma))*erfcx(x);
+    else
+        return 0.5*std::exp(k*(0.5*k*sigma*sigma - tau))*std::erfc(x);
+}
+
+irf_exp_model::irf_exp_model(const arma::vec& m, const arma::vec& t, 
+        arma::uword n_rates):
+    response_block(m),
+    tvec(t),
+    nrates(n_rates)
+{
+    log->debug("in irf_exp_model::irf_exp_model()");
+
+    if(m.n_elem != t.n_elem)
+        throw std::runtime_error("y and t vector lengths must match");
+    if(nrates == 0)
+        throw std::runtime_error("need at least one rate");
+
+    Amat.set_size(M, nrates + 1);
+    mjac.set_size(M, 3*nrates);
+
+    // every decay column depends on its own rate, sigma and t0
+    jidx.set_size(2, 3*nrates);
+    for(arma::uword j = 0; j < nrates; ++j) {
+        jidx(0, 3*j) = j + 1;
+        jidx(1, 3*j) = j;
+        jidx(0, 3*j + 1) = j + 1;
+        jidx(1, 3*j + 1) = nrates;
+        jidx(0, 3*j + 2) = j + 1;
+        jidx(1, 3*j + 2) = nrates + 1;
+    }
+    log->debug("jidx initialized to \n{}", jidx);
+
+    plabels.push_back("intercept");
+    for(arma::uword j = 0; j < nrates; ++j)
+        plabels.push_back("A" + std::to_string(j + 1));
+    for(arma::uword j = 0; j < nrates; ++j)
+        plabels.push_back("k" + std::to_string(j + 1));
+    plabels.push_back("sigma");
+    plabels.push_back("t0");
+}
+
+irf_exp_model::~irf_exp_model()
+{
+    log->debug("in irf_exp_model::~irf_exp_model()");
+}
+
+const char *irf_exp_model::name = "irf_exp_model";
 
+void irf_exp_model::evaluate_model(const arma::vec& p) 
+{
+    log->debug("in irf_exp_model::evaluate_model()");
+    if(p.n_elem != nrates + 2)
+        throw std::runtime_error("wrong number of nonlinear parameters");
+
+    // the gaussian only depends on sigma^2, so a step to negative sigma is
+    // evaluated at |sigma|
+    if(p(nrates) == 0.)
+        throw std::runtime_error("IRF width sigma must be nonzero");
+
+    const double sigma = std::abs(p(nrates)), t0 = p(nrates + 1);
+    const double *t = tvec.memptr();
+
+    Amat.col(0).ones();
+    for(arma::uword j = 0; j < nrates; ++j) {
+        const double k = p(j);
+        double *a = Amat.colptr(j + 1);
+        for(arma::uword i = 0; i < M; ++i)
+            a[i] = irf_exp(t[i] - t0, k, sigma);
+    }
+    log->debug("done updating Amat");
+}
+
+void irf_exp_model::evaluate_jacobian(const arma::vec& p)
+{
+    // With g = exp(a)*erfc(x)/2, a = k*(k*sigma^2/2 - tau) and
+    // x = (k*sigma^2 - tau)/(sigma*sqrt(2)), every derivative has the form
+    // dg = g*da - exp(-tau^2/(2 sigma^2))/sqrt(pi)*dx. update_model always
+    // evaluates the model first, so g is read back from Amat.
+    log->debug("in irf_exp_model::evaluate_jacobian()");
+    const double sigma = std::abs(p(nrates)), t0 = p(nrates + 1);
+    const double sign = p(nrates) < 0. ? -1. : 1.; // d|sigma|/dsigma
+    const double s2 = sigma*sigma;
+    const double *t = tvec.memptr();
+
+    for(arma::uword j = 0; j < nrates; ++j) {
+        const double k = p(j);
+        const double *g = Amat.colptr(j + 1);
+        double *dk = mjac.colptr(3*j);
+        double *ds = mjac.colptr(3*j + 1);
+        double *dt0 = mjac.colptr(3*j + 2);
+
+        for(arma::uword i = 0; i < M; ++i) {
+            double tau = t[i] - t0;
+            double G = isqrtpi*std::exp(-0.5*tau*tau/s2);
+            dk[i] = g[i]*(k*s2 - tau) - G*sigma/sqrt2;
+            ds[i] = sign*(g[i]*k*k*sigma - G*(k*s2 + tau)/(s2*sqrt2));
+            dt0[i] = g[i]*k - G/(sigma*sqrt2);
+        }
+    }
+    log->debug("done updating mjac");
+}
+
+const fit_report irf_exp_model::get_fit_report(double _a) const
+{
     std::vector <const char *> labels;
-    std::for_each(param_labels.begin(), param_labels.end(), 
-            [&](const char *s){labels.push_back(s);});
-    log->debug("vector size: {}", labels.size());
-    log->debug("alpha parameter: {}", _a);
+    std::for_each(plabels.begin(), plabels.end(), 
+            [&](const std::string &s){labels.push_back(s.c_str());});
 
-    return fit_report(name, H, params, resid, dof, labels, _a);
+    return make_fit_report(name, std::make_tuple(2*nrates + 2, true), labels, _a);
 }
+
+biexp_model::biexp_model(const arma::vec& m, const arma::vec& t):
+    ad_model(m, t)
+{
+    log->debug("in biexp_model::biexp_model()");
+}
+
+biexp_model::~biexp_model()
+{
+    log->debug("in biexp_model::~biexp_model()");
+}
+
+const char *biexp_model::name = "biexp_model";
+const dof_spec biexp_model::dof = std::make_tuple(4, true);
+const std::array<const char *, 5> biexp_model::param_labels = {"intercept", "A1", "A2", "k1", "k2" };
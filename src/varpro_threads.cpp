@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <set>
+#include <thread>
+#include "varpro_threads.h"
+
+#ifdef VARPRO_USE_MKL
+#include "mkl.h"
+#endif
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// set the BLAS thread count of the calling thread, returning the previous
+// setting (0 means the thread follows the global setting)
+static int set_local_blas_threads(int n)
+{
+#ifdef VARPRO_USE_MKL
+    return mkl_set_num_threads_local(n);
+#else
+    return 0;
+#endif
+}
+
+static void set_global_blas_threads(int n)
+{
+#ifdef VARPRO_USE_MKL
+    mkl_set_num_threads(n);
+#endif
+}
+
+// logical CPUs this process may run on, in increasing order
+static std::vector<unsigned int> allowed_cpus()
+{
+    std::vector<unsigned int> cpus;
+#if defined(_WIN32)
+    DWORD_PTR process_mask, system_mask;
+    if(GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+        for(unsigned int i = 0; i < 8*sizeof(DWORD_PTR); i++)
+            if(process_mask & (DWORD_PTR(1) << i))
+                cpus.push_back(i);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == 0)
+        for(unsigned int i = 0; i < CPU_SETSIZE; i++)
+            if(CPU_ISSET(i, &set))
+                cpus.push_back(i);
+#endif
+    return cpus;
+}
+
+// restrict the calling thread to cpus[first, first + count)
+static void pin_thread(const std::vector<unsigned int>& cpus,
+        unsigned int first, unsigned int count)
+{
+#if defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for(unsigned int i = first; i < first + count; i++)
+        mask |= DWORD_PTR(1) << cpus[i];
+    SetThreadAffinityMask(GetCurrentThread(), mask);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(unsigned int i = first; i < first + count; i++)
+        CPU_SET(cpus[i], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+// unmeasured placeholder; examples/bench_threads.py finds the real value
+const double thread_budget::default_crossover = 4e6;
+
+thread_budget::thread_budget():
+    cores(std::max(std::thread::hardware_concurrency(), 1u)),
+    crossover(default_crossover),
+    pin(false),
+    pool_blas(0),
+    pool_pin(false),
+    generation(0),
+    running(0),
+    stopping(false)
+{
+}
+
+thread_budget& thread_budget::instance()
+{
+    // never destroyed: joining the pool from a static destructor can deadlock
+    // while the module is being unloaded
+    static thread_budget *budget = new thread_budget;
+    return *budget;
+}
+
+bool thread_budget::controls_blas()
+{
+#ifdef VARPRO_USE_MKL
+    return true;
+#else
+    return false;
+#endif
+}
+
+void thread_budget::configure(unsigned int n_cores, double n_crossover, bool n_pin)
+{
+    if(n_crossover <= 0.)
+        throw std::logic_error("crossover must be positive");
+
+    if(n_cores == 0)
+        n_cores = std::max(std::thread::hardware_concurrency(), 1u);
+
+    std::lock_guard<std::mutex> run_guard(run_lock);
+    stop_pool();
+
+    std::lock_guard<std::mutex> guard(lock);
+    cores = n_cores;
+    crossover = n_crossover;
+    pin = n_pin;
+
+    // a single block updated from the calling thread gets the whole budget
+    set_global_blas_threads(cores);
+}
+
+const std::tuple<unsigned int, double, bool> thread_budget::get_config() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return std::make_tuple(cores, crossover, pin);
+}
+
+const std::tuple<unsigned int, unsigned int> thread_budget::plan(
+        arma::uword n_blocks, double work) const
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+#ifdef VARPRO_USE_MKL
+    unsigned int blas = 1;
+    if(work >= cores*crossover)
+        blas = cores;
+    else if(work >= crossover)
+        blas = static_cast<unsigned int>(work/crossover);
+
+    arma::uword workers = std::max(cores/blas, 1u);
+    workers = std::max(std::min(workers, n_blocks), arma::uword(1));
+
+    // with fewer blocks than the budget allows, BLAS gets the leftover cores
+    blas = std::max(cores/static_cast<unsigned int>(workers), 1u);
+#else
+    // the BLAS thread count is out of our hands, so every core runs a block
+    (void) work;
+    unsigned int blas = 1;
+    arma::uword workers = std::max(std::min(arma::uword(cores), n_blocks), arma::uword(1));
+#endif
+
+    return std::make_tuple(static_cast<unsigned int>(workers), blas);
+}
+
+void thread_budget::check_distinct(const std::vector<response_block*>& blocks)
+{
+    std::set<const response_block*> seen;
+    for(auto b : blocks)
+        if(!seen.insert(b).second)
+            throw std::runtime_error("each block may appear only once in update_blocks");
+}
+
+double thread_budget::block_work(const response_block& b)
+{
+    auto sz = b.get_size();
+    double n = std::get<1>(sz);
+    return std::get<0>(sz)*n*n;
+}
+
+void thread_budget::start_pool(unsigned int workers, unsigned int blas, bool pinned)
+{
+    // keep the current workers if they already match the plan
+    if(pool.size() == workers && pool_blas == blas && pool_pin == pinned)
+        return;
+
+    stop_pool();
+
+    // pin within the CPUs this process is allowed, and only if every worker
+    // gets cores of its own
+    std::vector<unsigned int> cpus;
+    if(pinned) {
+        cpus = allowed_cpus();
+        if(workers*blas > cpus.size()) {
+            spdlog::get("varpro")->warn("{} workers x {} BLAS threads exceed the {} allowed CPUs; not pinning",
+                    workers, blas, cpus.size());
+            cpus.clear();
+        }
+    }
+
+    pool_cpus = cpus;
+    pool_blas = blas;
+    pool_pin = pinned;
+    stopping = false;
+    for(unsigned int w = 0; w < workers; w++)
+        pool.push_back(std::thread(&thread_budget::worker_loop, this, w, generation));
+}
+
+void thread_budget::stop_pool()
+{
+    {
+        std::lock_guard<std::mutex> guard(pool_lock);
+        stopping = true;
+    }
+    pool_cv.notify_all();
+
+    for(auto &t : pool)
+        t.join();
+    pool.clear();
+}
+
+// seen is the job generation at start, so a job posted before the thread
+// first takes the lock is not missed
+void thread_budget::worker_loop(unsigned int w, unsigned long seen)
+{
+    std::unique_lock<std::mutex> guard(pool_lock);
+    if(!pool_cpus.empty())
+        pin_thread(pool_cpus, w*pool_blas, pool_blas);
+    set_local_blas_threads(pool_blas);
+
+    while(true) {
+        pool_cv.wait(guard, [&]{ return stopping || generation != seen; });
+        if(stopping)
+            return;
+
+        seen = generation;
+        auto task = job;
+        guard.unlock();
+        task(w);
+        guard.lock();
+
+        if(--running == 0)
+            done_cv.notify_all();
+    }
+}
+
+void thread_budget::update_blocks(const std::vector<response_block*>& blocks,
+        const std::vector<arma::vec>& params, bool update_jac)
+{
+    if(blocks.size() != params.size())
+        throw std::runtime_error("need one parameter vector per block");
+
+    check_distinct(blocks);
+    if(blocks.empty())
+        return;
+
+    std::lock_guard<std::mutex> run_guard(run_lock);
+
+    // size the plan for the largest block
+    double work = 0.;
+    for(auto b : blocks)
+        work = std::max(work, block_work(*b));
+
+    unsigned int workers, blas;
+    std::tie(workers, blas) = plan(blocks.size(), work);
+
+    std::atomic<size_t> next(0);
+    std::vector<std::exception_ptr> errors(workers);
+
+    auto run = [&](unsigned int w) {
+        try {
+            for(size_t i = next++; i < blocks.size(); i = next++)
+                blocks[i]->update_model(params[i], update_jac);
+        } catch(...) {
+            errors[w] = std::current_exception();
+        }
+    };
+
+    if(workers == 1) {
+        // stay on the calling thread, and leave its affinity alone
+        int prev = set_local_blas_threads(blas);
+        run(0);
+        set_local_blas_threads(prev);
+    } else {
+        start_pool(workers, blas, std::get<2>(get_config()));
+
+        std::unique_lock<std::mutex> guard(pool_lock);
+        job = run;
+        running = workers;
+        ++generation;
+        pool_cv.notify_all();
+        done_cv.wait(guard, [&]{ return running == 0; });
+        job = nullptr;
+    }
+
+    for(auto &e : errors)
+        if(e)
+            std::rethrow_exception(e);
+}
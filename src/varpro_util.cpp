@@ -1,4 +1,5 @@
 #include <armadillo>
+#include <cstring>
 #include <string>
 #include "pybind11/pybind11.h"
 #include "pybind11/numpy.h"
@@ -109,6 +110,53 @@ void umat_np_init(arma::umat &m, py::array inp)
     }
 }
 
+// copy a contiguous buffer of exactly nbytes bytes into dst
+static void buffer_copy(void *dst, py::buffer inp, size_t nbytes)
+{
+    py::buffer_info info = inp.request();
+
+    size_t stride = info.itemsize;
+    for(size_t i = 0; i < info.ndim; i++) {
+        if(size_t(info.strides[i]) != stride)
+            throw std::runtime_error("array not contiguous");
+        stride *= info.shape[i];
+    }
+
+    if(stride != nbytes)
+        throw std::runtime_error("buffer size does not match shape");
+
+    std::memcpy(dst, info.ptr, nbytes);
+}
+
+void vec_pickle_init(arma::vec &v, py::buffer inp, arma::uword n_rows)
+{
+    new (&v) arma::vec(n_rows);
+    buffer_copy(v.memptr(), inp, sizeof(arma::vec::elem_type)*v.n_elem);
+}
+
+void mat_pickle_init(arma::mat &m, py::buffer inp, arma::uword n_rows, arma::uword n_cols)
+{
+    new (&m) arma::mat(n_rows, n_cols);
+    buffer_copy(m.memptr(), inp, sizeof(arma::mat::elem_type)*m.n_elem);
+}
+
+void umat_pickle_init(arma::umat &m, py::buffer inp, arma::uword n_rows, arma::uword n_cols)
+{
+    new (&m) arma::umat(n_rows, n_cols);
+    buffer_copy(m.memptr(), inp, sizeof(arma::umat::elem_type)*m.n_elem);
+}
+
+// Payload for __reduce_ex__ of the armadillo types. Protocol 5 hands pickle a
+// view of the memory itself, so it can be sent out-of-band without copying;
+// older protocols get a bytes copy.
+py::object pickle_buffer(py::object self, const void *ptr, size_t nbytes, int protocol)
+{
+    if(protocol >= 5)
+        return py::module::import("pickle").attr("PickleBuffer")(self);
+
+    return py::bytes(reinterpret_cast<const char *>(ptr), nbytes);
+}
+
 /*
 np_yJ package_yJ(const response_block &b) 
 {